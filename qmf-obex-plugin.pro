@@ -1,5 +1,5 @@
 TEMPLATE = subdirs
 
-SUBDIRS = src
+SUBDIRS = src tools/obexload
 
 OTHER_FILES += rpm/qmf-obex-plugin.spec
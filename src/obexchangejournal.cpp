@@ -0,0 +1,153 @@
+#include "obexchangejournal.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QUuid>
+
+#include <QDebug>
+
+static const quint32 journalMagic = 0x4f424a31; // OBJ1
+// Sequence skipped on load, covers changes issued after the last save
+static const quint64 seqJump = 1 << 20;
+
+static QDataStream &operator<<(QDataStream &out, const ObexChangeJournal::Entry &e)
+{
+    return out << e.seq << e.message << e.kind << e.folder << e.oldFolder;
+}
+static QDataStream &operator>>(QDataStream &in, ObexChangeJournal::Entry &e)
+{
+    return in >> e.seq >> e.message >> e.kind >> e.folder >> e.oldFolder;
+}
+
+ObexChangeJournal::ObexChangeJournal(const QString &path, int capacity, QObject *parent) :
+    QObject(parent), _path(path), _capacity(capacity), _seq(0)
+{
+    if(!load()) {
+        _dbid = QUuid::createUuid().toString();
+        _entries.clear();
+        _folders.clear();
+        _threads.clear();
+        _seq = 0;
+        qDebug() << "Starting new change journal " << _dbid << " at " << _path;
+    } else {
+        // Numbers issued after the last save may have reached clients,
+        // never reissue them. The gap forces resync of such clients.
+        _seq += seqJump;
+    }
+    // Coalesce bursts of store signals into single write
+    _saver.setSingleShot(true);
+    _saver.setInterval(1000);
+    connect(&_saver, SIGNAL(timeout()), SLOT(save()));
+    save();
+}
+
+ObexChangeJournal::~ObexChangeJournal()
+{
+    if(_saver.isActive())
+        save();
+}
+
+bool ObexChangeJournal::load()
+{
+    QFile file(_path);
+    quint32 magic;
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    in >> magic;
+    if(magic != journalMagic) {
+        qDebug() << "Change journal " << _path << " has wrong format";
+        return false;
+    }
+    in >> _dbid >> _seq >> _entries >> _folders >> _threads;
+    if(in.status() != QDataStream::Ok) {
+        qDebug() << "Change journal " << _path << " is corrupted";
+        return false;
+    }
+    return true;
+}
+
+void ObexChangeJournal::save()
+{
+    QSaveFile file(_path);
+    _saver.stop();
+    if(!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Cannot write change journal " << _path << ": " << file.errorString();
+        return;
+    }
+    QDataStream out(&file);
+    out << journalMagic << _dbid << _seq << _entries << _folders << _threads;
+    if(!file.commit())
+        qDebug() << "Cannot write change journal " << _path << ": " << file.errorString();
+}
+
+void ObexChangeJournal::append(const Entry &e)
+{
+    _entries.append(e);
+    while(_entries.size() > _capacity)
+        _entries.removeFirst();
+    if(e.folder)
+        _folders.insert(e.folder, e.seq);
+    if(e.oldFolder)
+        _folders.insert(e.oldFolder, e.seq);
+    _saver.start();
+}
+
+void ObexChangeJournal::record(ChangeKind kind, const QMailMessageId &mid, const QMailFolderId &folder,
+                               const QMailFolderId &oldFolder, const QMailThreadId &thread)
+{
+    Entry e;
+    e.seq = ++_seq;
+    e.message = mid.toULongLong();
+    e.kind = kind;
+    e.folder = folder.toULongLong();
+    e.oldFolder = 0;
+    // Update which changes parent folder is a move
+    if(kind == Updated && oldFolder.isValid() && oldFolder != folder) {
+        e.kind = Moved;
+        e.oldFolder = oldFolder.toULongLong();
+    }
+    if(thread.isValid())
+        _threads.insert(thread.toULongLong(), e.seq);
+    append(e);
+}
+
+// Message is already gone from the store, caller supplies where it lived
+void ObexChangeJournal::recordRemoved(const QMailMessageId &mid, const QMailFolderId &folder, const QMailThreadId &thread)
+{
+    Entry e;
+    e.seq = ++_seq;
+    e.message = mid.toULongLong();
+    e.kind = Removed;
+    e.folder = folder.toULongLong();
+    e.oldFolder = 0;
+    if(thread.isValid())
+        _threads.insert(thread.toULongLong(), e.seq);
+    append(e);
+}
+
+/* Returns false if changes following since are not all in the journal -
+ * evicted, lost in a crash or since is from the future - client needs full
+ * resync. Cursor is the sequence to continue from: the last returned entry
+ * when max truncated the result, the journal head otherwise.
+ */
+bool ObexChangeJournal::changesSince(quint64 since, int max, QList<Entry> &out, quint64 &cursor) const
+{
+    int i;
+    cursor = _seq;
+    if(since > _seq)
+        return false;
+    if(since == _seq)
+        return true;
+    for(i = 0; i < _entries.size() && _entries.at(i).seq <= since; i++)
+        ;
+    // Sequence numbers are consecutive unless entries are missing
+    if(i == _entries.size() || _entries.at(i).seq != since + 1)
+        return false;
+    for(; i < _entries.size() && (max == 0 || out.size() < max); i++)
+        out.append(_entries.at(i));
+    if(i < _entries.size())
+        cursor = out.last().seq;
+    return true;
+}
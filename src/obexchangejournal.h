@@ -0,0 +1,65 @@
+#ifndef OBEXCHANGEJOURNAL_H
+#define OBEXCHANGEJOURNAL_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QTimer>
+
+#include <qmailid.h>
+
+/*
+ * Bounded persistent journal of message changes. Every change gets a
+ * monotonic sequence number, folders and threads remember sequence of
+ * their last change which serves as MAP version counter.
+ */
+class ObexChangeJournal : public QObject
+{
+    Q_OBJECT
+public:
+    enum ChangeKind {
+        Added,
+        Updated,
+        Moved,
+        Removed
+    };
+    struct Entry {
+        quint64 seq;
+        quint64 message;
+        quint8 kind;
+        quint64 folder;
+        quint64 oldFolder;
+    };
+
+    explicit ObexChangeJournal(const QString &path, int capacity = 4096, QObject *parent = 0);
+    ~ObexChangeJournal();
+
+    void record(ChangeKind kind, const QMailMessageId &mid, const QMailFolderId &folder,
+                const QMailFolderId &oldFolder, const QMailThreadId &thread);
+    void recordRemoved(const QMailMessageId &mid, const QMailFolderId &folder, const QMailThreadId &thread);
+
+    quint64 sequence() const { return _seq; }
+    const QString &databaseId() const { return _dbid; }
+    quint64 folderVersion(const QMailFolderId &fid) const { return _folders.value(fid.toULongLong()); }
+    quint64 threadVersion(const QMailThreadId &tid) const { return _threads.value(tid.toULongLong()); }
+
+    bool changesSince(quint64 since, int max, QList<Entry> &out, quint64 &cursor) const;
+
+private slots:
+    void save();
+
+private:
+    bool load();
+    void append(const Entry &e);
+
+    QString _path;
+    int _capacity;
+    quint64 _seq;
+    QString _dbid;
+    QList<Entry> _entries;
+    QHash<quint64, quint64> _folders;
+    QHash<quint64, quint64> _threads;
+    QTimer _saver;
+};
+
+#endif // OBEXCHANGEJOURNAL_H
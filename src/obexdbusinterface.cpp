@@ -1,14 +1,23 @@
 #include "obexdbusinterface.h"
+#include "obexchangejournal.h"
+#include "obexfoldercounts.h"
+#include "obextrace.h"
 
 #include <QtDBus/QDBusConnection>
 #include <QtDBus/QDBusMetaType>
+#include <QtDBus/QDBusMessage>
+#include <QtDBus/QDBusError>
 
 #include <qmailstore.h>
 #include <qmaildisconnected.h>
 #include <qmailserviceaction.h>
+#include <qmailnamespace.h>
 
+#include <QSharedPointer>
 #include <QDebug>
 
+#include <climits>
+
 const QString ObexDBusInterface::dbusService = "org.sailfish.qmf.obex";
 const QString ObexDBusInterface::dbusPath = "/org/sailfish/qmf/obex";
 
@@ -22,12 +31,25 @@ ObexDBusInterface::ObexDBusInterface(QObject *parent) : QObject(parent)
     dbusSession.registerObject(dbusPath, this,
         QDBusConnection::ExportScriptableSlots|QDBusConnection::ExportScriptableSignals);
 
+    if(qgetenv("QMF_OBEX_TRACE").toInt())
+        ObexTrace::setEnabled(true);
+
     _store = QMailStore::instance();
+    _journal = new ObexChangeJournal(QMail::dataPath() + "obex-journal.dat", 4096, this);
+    _counts = new ObexFolderCounts(_store);
+    // Index every account upfront, it is where removed messages are looked up
+    foreach (const QMailAccountId &mai, _store->queryAccounts())
+        _counts->load(mai);
     connect(_store, SIGNAL(messagesAdded(const QMailMessageIdList&)), SLOT(messagesAdded(QMailMessageIdList)));
     connect(_store, SIGNAL(messagesUpdated(const QMailMessageIdList&)), SLOT(messagesUpdated(QMailMessageIdList)));
     connect(_store, SIGNAL(messagesRemoved(const QMailMessageIdList&)), SLOT(messagesRemoved(QMailMessageIdList)));
 }
 
+ObexDBusInterface::~ObexDBusInterface()
+{
+    delete _counts;
+}
+
 static const char* msgType(QMailMessage::MessageType type)
 {
     switch(type) {
@@ -81,10 +103,15 @@ static const QMailFolderKey path2key(const QString folder)
 
 void ObexDBusInterface::notifyMessages(const QMailMessageIdList &ids, MAPEventType type)
 {
+    OBEX_TRACE_CAT("notifyMessages", "event");
     QMailMessageId qmi;
     foreach (qmi, ids) {
-        QMailMessage qmm = _store->message(qmi);
+        QMailMessage qmm;
         QVariantMap args;
+        {
+            OBEX_TRACE_CAT("store.message", "sql");
+            qmm = _store->message(qmi);
+        }
         args.insert("folder",flag2path(_store->folder(qmm.parentFolderId())));
         if(qmm.previousParentFolderId().isValid())
             args.insert("old_folder",flag2path(_store->folder(qmm.previousParentFolderId())));
@@ -94,13 +121,105 @@ void ObexDBusInterface::notifyMessages(const QMailMessageIdList &ids, MAPEventTy
             args.insert("sender_name",qmm.from().name());
             args.insert("priority",(qmm.status()&QMailMessage::HighPriority)?"yes":"no");
         }
+        OBEX_TRACE_CAT("mapEventReport", "dbus");
         emit mapEventReport(type, qmi.toULongLong(),msgType(qmm.messageType()),args);
     }
 }
 
+// Feeds change journal and folder counts from single metadata query
+void ObexDBusInterface::trackMessages(const QMailMessageIdList &ids, int kind)
+{
+    OBEX_TRACE_CAT("trackMessages", "event");
+    QMailMessageKey::Properties props = ObexFolderCounts::properties() | QMailMessageKey::PreviousParentFolderId;
+    QMailMessageMetaDataList mdl = _store->messagesMetaData(QMailMessageKey::id(ids), props);
+    QMailMessageMetaData qmd;
+    foreach (qmd, mdl) {
+        QMailFolderId folder;
+        QMailThreadId thread;
+        quint64 status = 0;
+        bool indexed = _counts->locate(qmd.id(), folder, thread, &status);
+        // Echo of our own manifest write, journal it only if something else changed too
+        if(_manifestPending.remove(qmd.id().toULongLong()) && indexed && folder == qmd.parentFolderId()
+                && thread == qmd.parentThreadId() && status == qmd.status())
+            continue;
+        // Indexed folder is where the message was before this change,
+        // QMF own record of the previous folder covers unindexed ones
+        if(!indexed)
+            folder = qmd.previousParentFolderId();
+        _journal->record((ObexChangeJournal::ChangeKind)kind, qmd.id(), qmd.parentFolderId(), folder, qmd.parentThreadId());
+    }
+    _counts->update(mdl);
+}
+
+/* Attachment manifest and reply-to are kept in custom fields so that
+ * getMetadata does not need to load and parse entire message for them.
+ * The manifest key tracks size and content availability the manifest
+ * was built for, it is rebuilt once more content is retrieved.
+ */
+static const QString manifestKey(const QMailMessageMetaData &qmd)
+{
+    return QString("%1:%2").arg(qmd.size()).arg(qmd.status() & (QMailMessage::ContentAvailable|QMailMessage::PartialContentAvailable));
+}
+
+// Manifest is only cached for fully downloaded messages, parts of partial
+// ones keep growing with fraction retrievals while the key stays the same
+static bool manifestCurrent(const QMailMessageMetaData &qmd)
+{
+    return qmd.contentAvailable() && qmd.customField("obex-manifest") == manifestKey(qmd);
+}
+
+// Attachment MIME types and summed size, the meaning of MAP AttachmentSize
+static qint64 attachmentManifest(QMailMessage &qmm, QStringList &mpl)
+{
+    QMailMessagePartContainer::Location pli;
+    qint64 size = 0;
+    foreach (pli, qmm.findAttachmentLocations()) {
+        const QMailMessagePart &part = qmm.partAt(pli);
+        mpl.append(part.contentType().toString(false,false));
+        if(part.contentDisposition().size() >= 0)
+            size += part.contentDisposition().size();
+        else if(part.hasBody())
+            size += part.body().length();
+    }
+    return size;
+}
+
+void ObexDBusInterface::updateManifests(const QMailMessageIdList &ids)
+{
+    OBEX_TRACE_CAT("updateManifests", "event");
+    QMailMessageKey::Properties props = QMailMessageKey::Id | QMailMessageKey::Size | QMailMessageKey::Status | QMailMessageKey::Custom;
+    QMailMessageMetaData qmd;
+
+    foreach (qmd, _store->messagesMetaData(QMailMessageKey::id(ids), props)) {
+        if(!qmd.contentAvailable() || manifestCurrent(qmd))
+            continue;
+        QMailMessage qmm = _store->message(qmd.id());
+        QStringList mpl;
+        qint64 size = attachmentManifest(qmm, mpl);
+        // Write custom fields only, the rest of metadata may have changed meanwhile.
+        // Store echoes this as update, trackMessages leaves it out of the journal.
+        QMailMessageMetaData data;
+        data.setCustomFields(qmd.customFields());
+        data.setCustomField("obex-attachment-mime", mpl.join(","));
+        data.setCustomField("obex-attachment-count", QString::number(mpl.size()));
+        data.setCustomField("obex-attachment-size", QString::number(size));
+        data.setCustomField("obex-replyto", qmm.replyTo().address());
+        data.setCustomField("obex-manifest", manifestKey(qmd));
+        // Mark before writing, the echo may be delivered from within the write
+        _manifestPending.insert(qmd.id().toULongLong());
+        if(!_store->updateMessagesMetaData(QMailMessageKey::id(qmd.id()), QMailMessageKey::Custom, data)) {
+            _manifestPending.remove(qmd.id().toULongLong());
+            qDebug() << "Cannot store attachment manifest for " << qmd.id().toULongLong();
+        }
+    }
+}
+
 void ObexDBusInterface::messagesAdded(const QMailMessageIdList &ids)
 {
+    OBEX_TRACE_CAT("messagesAdded", "event");
     QMailMessage *qmm;
+    trackMessages(ids, ObexChangeJournal::Added);
+    updateManifests(ids);
     if(!_queue.isEmpty()) {
         foreach (qmm, _queue) {
             if(ids.contains(qmm->id())) {
@@ -114,7 +233,10 @@ void ObexDBusInterface::messagesAdded(const QMailMessageIdList &ids)
 
 void ObexDBusInterface::messagesUpdated(const QMailMessageIdList &ids)
 {
+    OBEX_TRACE_CAT("messagesUpdated", "event");
     QMailMessage *qmm;
+    trackMessages(ids, ObexChangeJournal::Updated);
+    updateManifests(ids);
     if(!_queue.isEmpty()) {
         foreach (qmm, _queue) {
             if(ids.contains(qmm->id())) {
@@ -124,12 +246,24 @@ void ObexDBusInterface::messagesUpdated(const QMailMessageIdList &ids)
         }
     }
     qDebug() << "Modified events: " << ids;
-    // TODO: how to track changes??? Let's do it elsewhere
 }
 
 void ObexDBusInterface::messagesRemoved(const QMailMessageIdList &ids)
 {
+    OBEX_TRACE_CAT("messagesRemoved", "event");
     QMailMessage *qmm;
+    QMailMessageId qmi;
+    foreach (qmi, ids) {
+        QMailFolderId folder;
+        QMailThreadId thread;
+        _counts->locate(qmi, folder, thread);
+        _journal->recordRemoved(qmi, folder, thread);
+    }
+    _counts->remove(ids);
+    foreach (qmi, ids) {
+        _fetched.remove(qmi.toULongLong());
+        _manifestPending.remove(qmi.toULongLong());
+    }
     if(!_queue.isEmpty()) {
         foreach (qmm, _queue) {
             if(ids.contains(qmm->id())) {
@@ -143,6 +277,7 @@ void ObexDBusInterface::messagesRemoved(const QMailMessageIdList &ids)
 
 const QMailThreadIdList ObexDBusInterface::queryThreads(const QString &account, const QString &folder, quint16 max, quint16 offset) const
 {
+    OBEX_TRACE_CAT("queryThreads", "query");
     QMailThreadKey mtk;
     QMailAccountIdList mal;
 
@@ -164,6 +299,7 @@ const QMailThreadIdList ObexDBusInterface::queryThreads(const QString &account,
 
 const QVariantMap ObexDBusInterface::buildConversation(const QMailThreadId &mti) const
 {
+    OBEX_TRACE_CAT("buildConversation", "format");
     QVariantMap item;
     QVariantList users;
     QMailThread qmt = _store->thread(mti);
@@ -180,11 +316,13 @@ const QVariantMap ObexDBusInterface::buildConversation(const QMailThreadId &mti)
     }
     item.insert("participants", users);
     item.insert("account",_store->account(qmt.parentAccountId()).name());
+    item.insert("version",(qint64)_journal->threadVersion(mti));
     return item;
 }
 
 const QVariantList ObexDBusInterface::listThreads(const QString &account, const QString &folder, quint16 max, quint16 offset) const
 {
+    OBEX_TRACE_CAT("listThreads", "dbus");
     QVariantList ret;
     QMailThreadIdList mtl = queryThreads(account, folder, max, offset);
 
@@ -200,6 +338,7 @@ const QVariantList ObexDBusInterface::listThreads(const QString &account, const
 
 const QVariantList ObexDBusInterface::listFolders(const QString &account, const QString &folder, quint16 max, quint16 offset) const
 {
+    OBEX_TRACE_CAT("listFolders", "dbus");
     QVariantList ret;
     QMailFolderKey mfk;
     QMailFolderId mfi;
@@ -231,6 +370,46 @@ const QVariantList ObexDBusInterface::listFolders(const QString &account, const
             item.insert("count",qmf.serverCount());
             item.insert("unread",qmf.serverUnreadCount());
             item.insert("account",_store->account(qmf.parentAccountId()).name());
+            item.insert("version",(qint64)_journal->folderVersion(mfi));
+            _counts->load(qmf.parentAccountId());
+            item.insert("local_count",_counts->folder(mfi).total);
+            item.insert("local_unread",_counts->folder(mfi).unread);
+            ret.append(item);
+        }
+    }
+    return ret;
+}
+
+const QVariantList ObexDBusInterface::countFolders(const QStringList &accounts) const
+{
+    OBEX_TRACE_CAT("countFolders", "dbus");
+    QVariantList ret;
+    QMailAccountIdList mal;
+    QMailAccountId mai;
+    QString name;
+
+    if(accounts.isEmpty())
+        mal = _store->queryAccounts();
+    foreach (name, accounts)
+        mal += _store->queryAccounts(QMailAccountKey::name(name));
+    qDebug() << "Counting messages in folders of " << mal.length() << " accounts";
+    foreach (mai, mal) {
+        QString acc = _store->account(mai).name();
+        QMailFolderId mfi;
+        _counts->load(mai);
+        foreach (mfi, _store->queryFolders(QMailFolderKey::parentAccountId(mai), QMailFolderSortKey::path())) {
+            const ObexFolderCounts::Counts cnt = _counts->folder(mfi);
+            QVariantMap item;
+            QVariantMap types;
+            foreach (int type, cnt.types.keys()) {
+                if(cnt.types.value(type))
+                    types.insert(msgType((QMailMessage::MessageType)type), cnt.types.value(type));
+            }
+            item.insert("path", flag2path(_store->folder(mfi)));
+            item.insert("account", acc);
+            item.insert("count", cnt.total);
+            item.insert("unread", cnt.unread);
+            item.insert("types", types);
             ret.append(item);
         }
     }
@@ -254,6 +433,7 @@ const QVariantList ObexDBusInterface::listFolders(const QString &account, const
 #define TYPE_MAP2QMF(x) (((x & 0x10) << 1) | ((x & 0x4) << 1) | ((x & 0x1) <<2) | ((x & 0x8) >> 3))
 const QMailMessageKey ObexDBusInterface::prepareMessagesFilter(const QString &account, const QString &folder, const QVariantMap &filter) const
 {
+    OBEX_TRACE_CAT("prepareMessagesFilter", "query");
     QMailMessageKey mmk;
     QMailFolderKey mfk;
     QMailFolderIdList fil;
@@ -308,6 +488,7 @@ const QMailMessageKey ObexDBusInterface::prepareMessagesFilter(const QString &ac
 
 const QVariantMap ObexDBusInterface::getMetadata(qint64 id, quint32 mask) const
 {
+    OBEX_TRACE_CAT("getMetadata", "dbus");
     QVariantMap item;
     QMailMessage qmm;
     QMailMessageMetaData qmd, *ptr;
@@ -315,16 +496,21 @@ const QVariantMap ObexDBusInterface::getMetadata(qint64 id, quint32 mask) const
     if(!mask) // Set required fields only for empty mask
         mask = Subject | DateTime | RecipientAddressing | Type | Size | ReceptionStatus | AttachmentSize | ConversationId | Direction;
 
-    if(mask & (ReplyToAddressing|AttachmentMime)) {
-        // This is goddamn slow, obex client times out for default batch of 1000 so be sure to reduce the batch
+    {
+        OBEX_TRACE_CAT("store.messageMetaData", "sql");
+        qmd = _store->messageMetaData(QMailMessageId(id));
+    }
+    ptr = &qmd;
+    if(!manifestCurrent(qmd) && ((mask & (ReplyToAddressing|AttachmentMime))
+            || ((mask & AttachmentSize) && (qmd.status() & QMailMessage::HasAttachments)))) {
+        // No manifest (yet) - this is goddamn slow, obex client times out for default batch of 1000 so be sure to reduce the batch
+        OBEX_TRACE_CAT("store.message", "sql");
         qmm = _store->message(QMailMessageId(id));
         ptr = &qmm;
-    } else {
-        qmd = _store->messageMetaData(QMailMessageId(id));
-        ptr = &qmd;
     }
+    OBEX_TRACE_CAT("getMetadata.format", "format");
 
-    item.insert("account", _store->account(qmm.parentAccountId()).name());
+    item.insert("account", _store->account(ptr->parentAccountId()).name());
     item.insert("id", id);
 
     if(mask & Subject)
@@ -336,7 +522,7 @@ const QVariantMap ObexDBusInterface::getMetadata(qint64 id, quint32 mask) const
     if(mask&SenderAddressing)
         item.insert("sender_addressing",ptr->from().address());
     if(mask&ReplyToAddressing)
-        item.insert("replyto_addressing",((QMailMessage*)(ptr))->replyTo().address());
+        item.insert("replyto_addressing",(ptr == &qmm) ? qmm.replyTo().address() : qmd.customField("obex-replyto"));
     if(mask&RecipientName)
         item.insert("recipient_name",ptr->recipients().isEmpty()? "": ptr->recipients().at(0).name());
     if(mask&RecipientAddressing)
@@ -349,8 +535,15 @@ const QVariantMap ObexDBusInterface::getMetadata(qint64 id, quint32 mask) const
         item.insert("text",ptr->preview().length()>3?"yes":"no");
     if(mask&ReceptionStatus)
         item.insert("reception_status",ptr->contentAvailable()?"complete":(ptr->partialContentAvailable()?"fractioned":"notification"));
-    if(mask&AttachmentSize)
-        item.insert("attachment_size",QString::number((ptr->status()&QMailMessage::HasAttachments)?ptr->size():0));
+    if(mask&AttachmentSize) {
+        QStringList mpl;
+        if(ptr == &qmm)
+            item.insert("attachment_size",QString::number(attachmentManifest(qmm, mpl)));
+        else if(manifestCurrent(qmd))
+            item.insert("attachment_size",qmd.customField("obex-attachment-size"));
+        else
+            item.insert("attachment_size",QString("0"));
+    }
     if(mask&Priority)
         item.insert("priority", (ptr->status()&QMailMessage::HighPriority)?"yes":"no");
     if(mask&Read)
@@ -368,13 +561,12 @@ const QVariantMap ObexDBusInterface::getMetadata(qint64 id, quint32 mask) const
     if(mask&Direction)
         item.insert("direction", (ptr->status()&QMailMessage::Outgoing)?"outgoing":"incoming");
     if(mask&AttachmentMime) {
-        QList<QMailMessagePartContainer::Location> pll = ((QMailMessage*)(ptr))->findAttachmentLocations();
-        QMailMessagePartContainer::Location pli;
-        QStringList mpl;
-        foreach (pli, pll) {
-            mpl.append(((QMailMessage*)(ptr))->partAt(pli).contentType().toString(false,false));
-        }
-        item.insert("attachment_mime_types",mpl.join(","));
+        if(ptr == &qmm) {
+            QStringList mpl;
+            attachmentManifest(qmm, mpl);
+            item.insert("attachment_mime_types",mpl.join(","));
+        } else
+            item.insert("attachment_mime_types",qmd.customField("obex-attachment-mime"));
     }
 
     return item;
@@ -382,6 +574,7 @@ const QVariantMap ObexDBusInterface::getMetadata(qint64 id, quint32 mask) const
 
 const QList<qint64> ObexDBusInterface::listMessages(const QString &account, const QString &folder, quint16 max, quint16 offset, const QVariantMap &filter) const
 {
+    OBEX_TRACE_CAT("listMessages", "dbus");
     QList<qint64> ret;
     QMailMessageKey mmk;
     QMailMessageIdList qml;
@@ -397,9 +590,11 @@ const QList<qint64> ObexDBusInterface::listMessages(const QString &account, cons
     }
     qDebug() << "Listing " << max << " messages in " << folder << " from " << offset << " for account " << account;
     if(max == 0) {
+        OBEX_TRACE_CAT("store.countMessages", "sql");
         int cnt = _store->countMessages(mmk);
         ret.append(cnt);
     } else {
+        OBEX_TRACE_CAT("store.queryMessages", "sql");
         QMailMessageSortKey msk = QMailMessageSortKey::timeStamp(Qt::DescendingOrder) & QMailMessageSortKey::receptionTimeStamp(Qt::DescendingOrder);
         qml = _store->queryMessages(mmk,msk,max,offset);
         qDebug() << "Returning " << qml.length() << " entries";
@@ -409,20 +604,53 @@ const QList<qint64> ObexDBusInterface::listMessages(const QString &account, cons
     return ret;
 }
 
-const QVariantMap ObexDBusInterface::getMessage(qint64 id, quint32 flags) const
+// Bytes to request on top of what is already downloaded for FractionNext
+static const uint fractionSize = 32 * 1024;
+
+// Body bytes held locally, summed over parts without re-encoding the message.
+// Only used to tell whether a retrieval brought anything new.
+static quint64 partBytes(const QMailMessagePartContainer &ptc)
+{
+    quint64 len = 0;
+    if(ptc.multipartType() == QMailMessagePartContainer::MultipartNone)
+        return ptc.hasBody() ? ptc.body().length() : 0;
+    for(uint i = 0; i < ptc.partCount(); i++)
+        len += partBytes(ptc.partAt(i));
+    return len;
+}
+
+// Next retrieval minimum in raw bytes, never past what uint can carry
+static uint nextMinimum(quint64 have, quint64 more)
+{
+    return (uint)qMin<quint64>(have + qMax<quint64>(more, fractionSize), UINT_MAX);
+}
+
+static const QString bodyText(QMailMessage &qmm)
 {
-    QVariantMap ret;
-    QMailMessageId mid((quint64)id);
-    QMailMessage qmm = _store->message(mid);
     QMailMessagePartContainer *ptc = qmm.findPlainTextContainer();
-    QMailMessagePartContainer *htc= qmm.findHtmlContainer();
+    QMailMessagePartContainer *htc = qmm.findHtmlContainer();
+    if(ptc)
+        return QString::fromUtf8(ptc->body().data(QMailMessageBody::Decoded));
+    if(htc)
+        return QString::fromUtf8(htc->body().data(QMailMessageBody::Decoded));
+    return qmm.preview();
+}
+
+const QVariantMap ObexDBusInterface::buildMessage(const QMailMessageId &mid, quint32 flags, bool exhausted) const
+{
+    OBEX_TRACE_CAT("buildMessage", "format");
+    QVariantMap ret;
+    QMailMessage qmm;
     QMailFolder qmf;
+    {
+        OBEX_TRACE_CAT("store.message", "sql");
+        qmm = _store->message(mid);
+    }
     QMailAccount qma;
     if(!qmm.id().isValid()) {
-        qDebug() << "No such message with id " << id;
+        qDebug() << "No such message with id " << mid.toULongLong();
         return ret;
     }
-    qDebug() << "Fetching message " << mid.toULongLong() << " with flags " << flags;
     qmf = _store->folder(qmm.parentFolderId());
     qma = _store->account(qmm.parentAccountId());
     ret.insert("date",qmm.date().toString());
@@ -452,19 +680,122 @@ const QVariantMap ObexDBusInterface::getMessage(qint64 id, quint32 flags) const
     ret.insert("folder",flag2path(qmf));
     ret.insert("account",qma.name());
     ret.insert("length", qmm.body().length());
-    ret.insert("body",qmm.body().data(QMailMessageBody::Decoded));
-    if(ptc) {
-        ret.insert("body",QString::fromUtf8(ptc->body().data(QMailMessageBody::Decoded)));
-    } else if(htc) {
-        ret.insert("body",QString::fromUtf8(htc->body().data(QMailMessageBody::Decoded)));
-    } else {
-        ret.insert("body", qmm.preview());
+    ret.insert("body", bodyText(qmm));
+    if(flags & (FractionFirst|FractionNext))
+        ret.insert("fraction_deliver", (qmm.contentAvailable() || exhausted) ? "last" : "more");
+    return ret;
+}
+
+const QVariantMap ObexDBusInterface::buildRange(const QMailMessageId &mid, quint32 offset, quint32 length, bool exhausted) const
+{
+    OBEX_TRACE_CAT("buildRange", "format");
+    QVariantMap ret;
+    QMailMessage qmm = _store->message(mid);
+    if(!qmm.id().isValid()) {
+        qDebug() << "No such message with id " << mid.toULongLong();
+        return ret;
     }
+    QByteArray text = bodyText(qmm).toUtf8();
+    ret.insert("id", (qint64)mid.toULongLong());
+    ret.insert("offset", offset);
+    ret.insert("data", text.mid(offset, length));
+    ret.insert("total", text.size());
+    ret.insert("fraction_deliver", ((qmm.contentAvailable() || exhausted) && (quint64)offset + length >= (quint64)text.size()) ? "last" : "more");
     return ret;
 }
+
+/* Defers D-Bus reply until retrieval of the message brings new content.
+ * Minimum is counted in raw message bytes, which we do not measure locally:
+ * it continues from the last minimum requested for the message and doubles
+ * while retrievals bring nothing, up to the whole message. Builder is told when the message is exhausted that way.
+ * Returns false when not called over D-Bus - caller has to reply synchronously then.
+ */
+bool ObexDBusInterface::retrieveAndReply(const QMailMessageId &mid, quint64 have, quint64 more, std::function<QVariantMap(bool)> build)
+{
+    if(!calledFromDBus())
+        return false;
+    setDelayedReply(true);
+    QDBusMessage req = message();
+    QDBusConnection conn = connection();
+    QMailRetrievalAction *mra = new QMailRetrievalAction(this);
+    // Raw bytes held are at least the decoded ones, start from there for unseen messages
+    QSharedPointer<uint> minimum(new uint(nextMinimum(qMax<quint64>(_fetched.value(mid.toULongLong()), have), more)));
+    qint64 start = ObexTrace::enabled() ? ObexTrace::now() : 0;
+    connect(mra, &QMailRetrievalAction::activityChanged, [=](QMailServiceAction::Activity a){
+        if(a == QMailServiceAction::Successful || a == QMailServiceAction::Failed) {
+            if(a == QMailServiceAction::Failed) {
+                mra->deleteLater();
+                qDebug() << "Retrieval of " << mid.toULongLong() << " up to " << *minimum << " failed: " << mra->status().text;
+                conn.send(req.createErrorReply(QDBusError::Failed, mra->status().text));
+                return;
+            }
+            _fetched.insert(mid.toULongLong(), *minimum);
+            QMailMessage qmm = _store->message(mid);
+            bool progress = qmm.contentAvailable() || partBytes(qmm) > have;
+            if(!progress && *minimum < qmm.size() && *minimum < UINT_MAX) {
+                *minimum = nextMinimum(*minimum, *minimum);
+                qDebug() << "No new content of " << mid.toULongLong() << ", requesting " << *minimum << " bytes";
+                mra->retrieveMessageRange(mid, *minimum);
+                return;
+            }
+            mra->deleteLater();
+            if(start && ObexTrace::enabled())
+                ObexTrace::record("retrieveMessageRange", "retrieval", start, ObexTrace::now());
+            OBEX_TRACE_CAT("delayedReply", "dbus");
+            qDebug() << "Retrieval of " << mid.toULongLong() << " up to " << *minimum << " complete" << (progress ? "" : ", no new content");
+            if(qmm.contentAvailable())
+                _fetched.remove(mid.toULongLong());
+            conn.send(req.createReply(QVariant(build(!progress))));
+        }
+    });
+    qDebug() << "Requesting " << *minimum << " bytes of message " << mid.toULongLong();
+    mra->retrieveMessageRange(mid, *minimum);
+    return true;
+}
+
+const QVariantMap ObexDBusInterface::getMessage(qint64 id, quint32 flags)
+{
+    OBEX_TRACE_CAT("getMessage", "dbus");
+    QMailMessageId mid((quint64)id);
+    QMailMessageMetaData qmd = _store->messageMetaData(mid);
+    if(!qmd.id().isValid()) {
+        qDebug() << "No such message with id " << id;
+        return QVariantMap();
+    }
+    qDebug() << "Fetching message " << mid.toULongLong() << " with flags " << flags;
+    if(!qmd.contentAvailable() && ((flags & FractionNext) || ((flags & FractionFirst) && !qmd.partialContentAvailable()))) {
+        quint64 have = 0;
+        if(qmd.partialContentAvailable())
+            have = partBytes(_store->message(mid));
+        if(retrieveAndReply(mid, have, fractionSize, [=](bool exhausted){ return buildMessage(mid, flags, exhausted); }))
+            return QVariantMap();
+    }
+    return buildMessage(mid, flags);
+}
+
+const QVariantMap ObexDBusInterface::getMessageRange(qint64 id, quint32 offset, quint32 length)
+{
+    OBEX_TRACE_CAT("getMessageRange", "dbus");
+    QMailMessageId mid((quint64)id);
+    QMailMessage qmm = _store->message(mid);
+    if(!qmm.id().isValid()) {
+        qDebug() << "No such message with id " << id;
+        return QVariantMap();
+    }
+    qDebug() << "Fetching " << length << " bytes from " << offset << " of message " << id;
+    quint64 end = (quint64)offset + length;
+    quint64 text = bodyText(qmm).toUtf8().size();
+    if(!qmm.contentAvailable() && text < end) {
+        // Encoded content is at least as long as decoded one, ask for at least the missing bytes
+        if(retrieveAndReply(mid, partBytes(qmm), end - text, [=](bool exhausted){ return buildRange(mid, offset, length, exhausted); }))
+            return QVariantMap();
+    }
+    return buildRange(mid, offset, length);
+}
 // sqlite3 uses signed 64-bit integers.
 qint64 ObexDBusInterface::putMessage(const QVariantMap data, quint32 flags)
 {
+    OBEX_TRACE_CAT("putMessage", "dbus");
     QMailMessageId qmi;
     QMailTransmitAction *mta;
     QMailMessage *qmm = new QMailMessage();
@@ -541,6 +872,7 @@ qint64 ObexDBusInterface::putMessage(const QVariantMap data, quint32 flags)
 
 int ObexDBusInterface::setMessage(qint64 id, quint8 indicator, bool value)
 {
+    OBEX_TRACE_CAT("setMessage", "dbus");
     int ret = 0;
     QMailMessageMetaData mmd = _store->messageMetaData(QMailMessageId(id));
     if(!mmd.id().isValid()) {
@@ -584,8 +916,62 @@ int ObexDBusInterface::setMessage(qint64 id, quint8 indicator, bool value)
     return ret;
 }
 
+static const char* changeKind(quint8 kind)
+{
+    switch(kind) {
+    case ObexChangeJournal::Added:
+        return "added";
+    case ObexChangeJournal::Updated:
+        return "updated";
+    case ObexChangeJournal::Moved:
+        return "moved";
+    case ObexChangeJournal::Removed:
+        return "removed";
+    default:
+        return "unknown";
+    }
+}
+
+const QVariantMap ObexDBusInterface::listChanges(qint64 since, quint16 max) const
+{
+    OBEX_TRACE_CAT("listChanges", "dbus");
+    QVariantMap ret;
+    QVariantList changes;
+    QList<ObexChangeJournal::Entry> el;
+    QHash<quint64, QString> paths;
+    quint64 cursor;
+    bool complete = _journal->changesSince(since < 0 ? 0 : since, max, el, cursor);
+
+    qDebug() << "Listing " << max << " changes since " << since << " of " << _journal->sequence();
+    foreach (const ObexChangeJournal::Entry &e, el) {
+        QVariantMap item;
+        item.insert("seq", (qint64)e.seq);
+        item.insert("id", (qint64)e.message);
+        item.insert("change", changeKind(e.kind));
+        if(e.folder) {
+            if(!paths.contains(e.folder))
+                paths.insert(e.folder, flag2path(_store->folder(QMailFolderId(e.folder))));
+            item.insert("folder", paths.value(e.folder));
+        }
+        if(e.oldFolder) {
+            if(!paths.contains(e.oldFolder))
+                paths.insert(e.oldFolder, flag2path(_store->folder(QMailFolderId(e.oldFolder))));
+            item.insert("old_folder", paths.value(e.oldFolder));
+        }
+        changes.append(item);
+    }
+    ret.insert("database_id", _journal->databaseId());
+    // Cursor to pass as since next time, more is set when max cut the listing
+    ret.insert("seq", (qint64)cursor);
+    ret.insert("more", cursor < _journal->sequence());
+    ret.insert("complete", complete);
+    ret.insert("changes", changes);
+    return ret;
+}
+
 int ObexDBusInterface::updateFolder(const QString &account, const QString &folder, int min)
 {
+    OBEX_TRACE_CAT("updateFolder", "dbus");
     QMailAccountKey mak = account.isEmpty() ? QMailAccountKey() : QMailAccountKey::name(account);
     QMailAccountIdList mal = _store->queryAccounts(mak);
     QMailAccountId mai;
@@ -617,8 +1003,19 @@ int ObexDBusInterface::updateFolder(const QString &account, const QString &folde
     return ret;
 }
 
+void ObexDBusInterface::setTracing(bool enable)
+{
+    ObexTrace::setEnabled(enable);
+}
+
+const QString ObexDBusInterface::dumpTrace() const
+{
+    return QString::fromLatin1(ObexTrace::dump());
+}
+
 const QVariantList ObexDBusInterface::listAccounts() const
 {
+    OBEX_TRACE_CAT("listAccounts", "dbus");
     QMailAccountIdList mal = _store->queryAccounts();
     QMailAccountId mai;
     QVariantList ret;
@@ -629,6 +1026,7 @@ const QVariantList ObexDBusInterface::listAccounts() const
         item.insert("address",qma.fromAddress().address());
         item.insert("mtime",qma.lastSynchronized().toString());
         item.insert("mtype",msgType(qma.messageType()));
+        item.insert("database_id",_journal->databaseId());
         ret.append(item);
     }
     return ret;
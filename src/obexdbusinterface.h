@@ -3,16 +3,23 @@
 
 #include <QVariantMap>
 #include <QtDBus/QDBusArgument>
+#include <QtDBus/QDBusContext>
 #include <QList>
+#include <QHash>
+#include <QSet>
+
+#include <functional>
 
 #include <qmailid.h>
 
 class QMailStore;
 class QMailMessage;
 class QMailMessageKey;
+class ObexChangeJournal;
+class ObexFolderCounts;
 Q_DECLARE_METATYPE(QList<qint64>)
 
-class ObexDBusInterface : public QObject
+class ObexDBusInterface : public QObject, protected QDBusContext
 {
     Q_OBJECT
     Q_CLASSINFO("D-Bus Interface", "org.sailfish.qmf.obex")
@@ -20,6 +27,7 @@ public:
     static const QString dbusService;
     static const QString dbusPath;
     explicit ObexDBusInterface(QObject *parent = 0);
+    ~ObexDBusInterface();
 
     enum MAPEventType {
         NewMessage,
@@ -58,20 +66,31 @@ public:
         Reserved         = 0x200000     // 21-31
     };
     Q_DECLARE_FLAGS(MaskParams, FilterParamMask)
+    enum MessageFlags {
+        FractionFirst    = 0x01,        // 0 - fetch first fraction if nothing is downloaded
+        FractionNext     = 0x02         // 1 - fetch next fraction beyond what is downloaded
+    };
 
 public slots:
     Q_SCRIPTABLE const QVariantList listAccounts() const;
     Q_SCRIPTABLE const QVariantList listFolders(const QString &account, const QString &folder, quint16 max, quint16 offset) const;
     Q_SCRIPTABLE const QVariantList listThreads(const QString &account, const QString &folder, quint16 max, quint16 offset) const;
+    Q_SCRIPTABLE const QVariantList countFolders(const QStringList &accounts) const;
     Q_SCRIPTABLE const QList<qint64> listMessages(const QString &account, const QString &folder, quint16 max, quint16 offset, const QVariantMap &filter) const;
 
     Q_SCRIPTABLE const QVariantMap getMetadata(qint64, quint32 mask) const;
-    Q_SCRIPTABLE const QVariantMap getMessage(qint64 id, quint32 flags) const;
+    Q_SCRIPTABLE const QVariantMap getMessage(qint64 id, quint32 flags);
+    Q_SCRIPTABLE const QVariantMap getMessageRange(qint64 id, quint32 offset, quint32 length);
     Q_SCRIPTABLE qint64 putMessage(const QVariantMap data, quint32 flags);
     Q_SCRIPTABLE int setMessage(qint64 id, quint8 indicator, bool value);
 
+    Q_SCRIPTABLE const QVariantMap listChanges(qint64 since, quint16 max) const;
+
     Q_SCRIPTABLE int updateFolder(const QString &account, const QString &folder, int min);
 
+    Q_SCRIPTABLE void setTracing(bool enable);
+    Q_SCRIPTABLE const QString dumpTrace() const;
+
 signals:
     Q_SCRIPTABLE void mapEventReport(quint8 type, qint64 id, const QString &msg_type, const QVariantMap &kvargs) const;
 
@@ -86,12 +105,21 @@ private slots:
     void collectListing(const QMailMessageIdList&,quint32,QVariantList&);
 
 private:
+    void trackMessages(const QMailMessageIdList &ids, int kind);
+    void updateManifests(const QMailMessageIdList &ids);
     const QMailMessageKey prepareMessagesFilter(const QString &account, const QString &folder, const QVariantMap &filter) const;
     const QMailThreadIdList queryThreads(const QString &account, const QString &folder, quint16 max, quint16 offset) const;
     const QVariantMap buildConversation(const QMailThreadId &mti) const;
+    const QVariantMap buildMessage(const QMailMessageId &mid, quint32 flags, bool exhausted = false) const;
+    const QVariantMap buildRange(const QMailMessageId &mid, quint32 offset, quint32 length, bool exhausted = false) const;
+    bool retrieveAndReply(const QMailMessageId &mid, quint64 have, quint64 more, std::function<QVariantMap(bool)> build);
 
     QMailStore *_store;
+    ObexChangeJournal *_journal;
+    ObexFolderCounts *_counts;
     QList<QMailMessage*> _queue;
+    QHash<quint64, uint> _fetched;
+    QSet<quint64> _manifestPending;
 };
 
 #endif // OBEXDBUSINTERFACE_H
@@ -0,0 +1,94 @@
+#include "obexfoldercounts.h"
+
+#include <qmailstore.h>
+
+#include <QDebug>
+
+ObexFolderCounts::ObexFolderCounts(QMailStore *store) : _store(store)
+{
+}
+
+// Metadata properties update() needs
+QMailMessageKey::Properties ObexFolderCounts::properties()
+{
+    return QMailMessageKey::Id | QMailMessageKey::ParentAccountId | QMailMessageKey::ParentFolderId
+         | QMailMessageKey::ParentThreadId | QMailMessageKey::Status | QMailMessageKey::Type;
+}
+
+void ObexFolderCounts::apply(const Entry &e, int delta)
+{
+    Counts &c = _folders[e.folder];
+    c.total += delta;
+    if(e.unread)
+        c.unread += delta;
+    c.types[e.type] += delta;
+}
+
+void ObexFolderCounts::load(const QMailAccountId &mai)
+{
+    QMailMessageMetaData qmd;
+    int cnt = 0;
+    if(_accounts.contains(mai.toULongLong()))
+        return;
+    _accounts.insert(mai.toULongLong());
+    foreach (qmd, _store->messagesMetaData(QMailMessageKey::parentAccountId(mai), properties())) {
+        Entry e;
+        if(_messages.contains(qmd.id().toULongLong()))
+            apply(_messages.value(qmd.id().toULongLong()), -1);
+        e.folder = qmd.parentFolderId().toULongLong();
+        e.thread = qmd.parentThreadId().toULongLong();
+        e.status = qmd.status();
+        e.type = qmd.messageType();
+        e.unread = !(qmd.status() & QMailMessage::Read);
+        _messages.insert(qmd.id().toULongLong(), e);
+        apply(e, 1);
+        cnt++;
+    }
+    qDebug() << "Aggregated counts for account " << mai.toULongLong() << " over " << cnt << " messages";
+}
+
+void ObexFolderCounts::update(const QMailMessageMetaDataList &mdl)
+{
+    QMailMessageMetaData qmd;
+    foreach (qmd, mdl) {
+        quint64 id = qmd.id().toULongLong();
+        if(!_accounts.contains(qmd.parentAccountId().toULongLong())) {
+            // New account, aggregating it picks up this message as well
+            if(_messages.contains(id))
+                apply(_messages.take(id), -1);
+            load(qmd.parentAccountId());
+            continue;
+        }
+        Entry e;
+        e.folder = qmd.parentFolderId().toULongLong();
+        e.thread = qmd.parentThreadId().toULongLong();
+        e.status = qmd.status();
+        e.type = qmd.messageType();
+        e.unread = !(qmd.status() & QMailMessage::Read);
+        if(_messages.contains(id))
+            apply(_messages.value(id), -1);
+        _messages.insert(id, e);
+        apply(e, 1);
+    }
+}
+
+bool ObexFolderCounts::locate(const QMailMessageId &mid, QMailFolderId &folder, QMailThreadId &thread, quint64 *status) const
+{
+    if(!_messages.contains(mid.toULongLong()))
+        return false;
+    const Entry e = _messages.value(mid.toULongLong());
+    folder = QMailFolderId(e.folder);
+    thread = QMailThreadId(e.thread);
+    if(status)
+        *status = e.status;
+    return true;
+}
+
+void ObexFolderCounts::remove(const QMailMessageIdList &ids)
+{
+    QMailMessageId qmi;
+    foreach (qmi, ids) {
+        if(_messages.contains(qmi.toULongLong()))
+            apply(_messages.take(qmi.toULongLong()), -1);
+    }
+}
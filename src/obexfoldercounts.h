@@ -0,0 +1,59 @@
+#ifndef OBEXFOLDERCOUNTS_H
+#define OBEXFOLDERCOUNTS_H
+
+#include <QHash>
+#include <QMap>
+#include <QSet>
+
+#include <qmailid.h>
+#include <qmailmessage.h>
+#include <qmailmessagekey.h>
+
+class QMailStore;
+
+/*
+ * Local per-folder message/unread/type counts. Account is aggregated in
+ * single metadata pass on first request and then kept current from store
+ * change signals using compact per-message index. The index also tells
+ * where removed and moved messages used to live.
+ */
+class ObexFolderCounts
+{
+public:
+    struct Counts {
+        Counts() : total(0), unread(0) {}
+        int total;
+        int unread;
+        QMap<int, int> types; // QMailMessage::MessageType -> count
+    };
+
+    explicit ObexFolderCounts(QMailStore *store);
+
+    static QMailMessageKey::Properties properties();
+
+    void load(const QMailAccountId &mai);
+    const Counts folder(const QMailFolderId &mfi) const { return _folders.value(mfi.toULongLong()); }
+
+    bool locate(const QMailMessageId &mid, QMailFolderId &folder, QMailThreadId &thread, quint64 *status = 0) const;
+
+    void update(const QMailMessageMetaDataList &mdl);
+    void remove(const QMailMessageIdList &ids);
+
+private:
+    struct Entry {
+        quint64 folder;
+        quint64 thread;
+        quint64 status;
+        int type;
+        bool unread;
+    };
+
+    void apply(const Entry &e, int delta);
+
+    QMailStore *_store;
+    QSet<quint64> _accounts;
+    QHash<quint64, Entry> _messages;
+    QHash<quint64, Counts> _folders;
+};
+
+#endif // OBEXFOLDERCOUNTS_H
@@ -0,0 +1,81 @@
+#include "obextrace.h"
+
+#include <QVector>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QCoreApplication>
+#include <QThread>
+
+#include <QDebug>
+
+struct TraceEvent {
+    const char *name;
+    const char *cat;
+    qint64 start;
+    qint64 end;
+    quintptr tid;
+};
+
+bool ObexTrace::_enabled = false;
+
+static QMutex traceLock;
+static QVector<TraceEvent> ring;
+static int ringHead = 0;
+static int ringCount = 0;
+static QElapsedTimer traceClock;
+
+void ObexTrace::setEnabled(bool enable, int capacity)
+{
+    QMutexLocker lock(&traceLock);
+    if(enable && !_enabled) {
+        ring.resize(qMax(1, capacity));
+        ringHead = 0;
+        ringCount = 0;
+        // Started once, spans still open across re-enabling keep valid times
+        if(!traceClock.isValid())
+            traceClock.start();
+    }
+    _enabled = enable;
+    qDebug() << "Tracing " << (enable ? "enabled" : "disabled");
+}
+
+// Microseconds since tracing was first enabled
+qint64 ObexTrace::now()
+{
+    return traceClock.nsecsElapsed() / 1000;
+}
+
+void ObexTrace::record(const char *name, const char *cat, qint64 start, qint64 end)
+{
+    QMutexLocker lock(&traceLock);
+    if(ring.isEmpty())
+        return;
+    TraceEvent &ev = ring[ringHead];
+    ev.name = name;
+    ev.cat = cat;
+    ev.start = start;
+    ev.end = end;
+    ev.tid = (quintptr)QThread::currentThreadId();
+    ringHead = (ringHead + 1) % ring.size();
+    if(ringCount < ring.size())
+        ringCount++;
+}
+
+QByteArray ObexTrace::dump()
+{
+    QMutexLocker lock(&traceLock);
+    QByteArray out("{\"traceEvents\":[");
+    qint64 pid = QCoreApplication::applicationPid();
+    int first = (ringHead - ringCount + ring.size()) % qMax(1, ring.size());
+    for(int i = 0; i < ringCount; i++) {
+        const TraceEvent &ev = ring.at((first + i) % ring.size());
+        if(i)
+            out.append(',');
+        // Span names are literals from the code, no escaping needed
+        out.append(QString("{\"name\":\"%1\",\"cat\":\"%2\",\"ph\":\"X\",\"ts\":%3,\"dur\":%4,\"pid\":%5,\"tid\":%6}")
+                   .arg(ev.name).arg(ev.cat).arg(ev.start).arg(ev.end - ev.start).arg(pid).arg((quint64)ev.tid).toLatin1());
+    }
+    out.append("],\"displayTimeUnit\":\"ms\"}");
+    return out;
+}
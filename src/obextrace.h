@@ -0,0 +1,56 @@
+#ifndef OBEXTRACE_H
+#define OBEXTRACE_H
+
+#include <QtGlobal>
+#include <QByteArray>
+
+/*
+ * Lightweight span tracer. Finished spans go to fixed size ring buffer
+ * which is dumped as Chrome/Perfetto trace JSON. When tracing is off a
+ * span costs single branch, building with OBEX_NO_TRACE removes them.
+ */
+class ObexTrace
+{
+public:
+    static bool enabled() { return _enabled; }
+    static void setEnabled(bool enable, int capacity = 16384);
+    static qint64 now();
+    static void record(const char *name, const char *cat, qint64 start, qint64 end);
+    static QByteArray dump();
+
+private:
+    static bool _enabled;
+};
+
+class ObexTraceSpan
+{
+public:
+    ObexTraceSpan(const char *name, const char *cat = "obex") : _name(0)
+    {
+        if(ObexTrace::enabled()) {
+            _name = name;
+            _cat = cat;
+            _start = ObexTrace::now();
+        }
+    }
+    ~ObexTraceSpan()
+    {
+        if(_name)
+            ObexTrace::record(_name, _cat, _start, ObexTrace::now());
+    }
+
+private:
+    const char *_name;
+    const char *_cat;
+    qint64 _start;
+};
+
+#ifdef OBEX_NO_TRACE
+#define OBEX_TRACE_CAT(name, cat)
+#else
+#define OBEX_TRACE_VAR2(line) _obex_span_##line
+#define OBEX_TRACE_VAR(line) OBEX_TRACE_VAR2(line)
+#define OBEX_TRACE_CAT(name, cat) ObexTraceSpan OBEX_TRACE_VAR(__LINE__)(name, cat)
+#endif
+
+#endif // OBEXTRACE_H
@@ -18,10 +18,16 @@ INSTALLS += target
 
 HEADERS += \
     obexdbusplugin.h \
-    obexdbusinterface.h
+    obexdbusinterface.h \
+    obexchangejournal.h \
+    obextrace.h \
+    obexfoldercounts.h
 
 SOURCES += \
     obexdbusplugin.cpp \
-    obexdbusinterface.cpp
+    obexdbusinterface.cpp \
+    obexchangejournal.cpp \
+    obextrace.cpp \
+    obexfoldercounts.cpp
 
 INCLUDEPATH += /home/ruff/co/messagingframework/qmf/src/libraries/qmfclient
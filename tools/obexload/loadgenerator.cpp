@@ -0,0 +1,290 @@
+#include "loadgenerator.h"
+#include "obexdbusinterface.h"
+
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QTextStream>
+#include <QtDBus/QDBusMessage>
+#include <QtDBus/QDBusPendingCallWatcher>
+#include <QtDBus/QDBusArgument>
+
+#include <algorithm>
+
+#include <QDebug>
+
+/* Argument types of the exported methods:
+ * s - string, q - uint16, u - uint32, y - byte, b - bool, i - int32,
+ * x - int64 (message id), m - string/variant map, l - string list
+ */
+static const struct {
+    const char *method;
+    const char *sig;
+} signatures[] = {
+    { "listAccounts",    "" },
+    { "listFolders",     "ssqq" },
+    { "listThreads",     "ssqq" },
+    { "countFolders",    "l" },
+    { "listMessages",    "ssqqm" },
+    { "getMetadata",     "xu" },
+    { "getMessage",      "xu" },
+    { "getMessageRange", "xuu" },
+    { "putMessage",      "mu" },
+    { "setMessage",      "xyb" },
+    { "listChanges",     "xq" },
+    { "updateFolder",    "ssi" },
+    { "setTracing",      "b" },
+    { "dumpTrace",       "" }
+};
+
+static const char *signature(const QString &method)
+{
+    for(uint i = 0; i < sizeof(signatures)/sizeof(signatures[0]); i++) {
+        if(method == signatures[i].method)
+            return signatures[i].sig;
+    }
+    return 0;
+}
+
+static qint64 percentile(const QVector<qint64> &sorted, double p)
+{
+    if(sorted.isEmpty())
+        return 0;
+    return sorted.at(qMin(sorted.size() - 1, (int)(p * sorted.size())));
+}
+
+static const QString procStatus(qint64 pid, const QString &field)
+{
+    QFile status(QString("/proc/%1/status").arg(pid));
+    if(!status.open(QIODevice::ReadOnly))
+        return QString("n/a");
+    foreach (const QByteArray &line, status.readAll().split('\n')) {
+        if(line.startsWith(field.toLatin1() + ":"))
+            return QString::fromLatin1(line.mid(field.length() + 1)).simplified();
+    }
+    return QString("n/a");
+}
+
+LoadGenerator::LoadGenerator(const QDBusConnection &conn, int concurrency, double speed, QObject *parent) :
+    QObject(parent), _conn(conn), _concurrency(qMax(1, concurrency)), _speed(speed),
+    _next(0), _inflight(0), _errors(0), _events(0), _elapsed(0)
+{
+    _timer.setSingleShot(true);
+    connect(&_timer, SIGNAL(timeout()), SLOT(dispatch()));
+    _conn.connect(QString(), ObexDBusInterface::dbusPath, ObexDBusInterface::dbusService,
+                  "mapEventReport", this, SLOT(mapEvent(QDBusMessage)));
+}
+
+bool LoadGenerator::loadTrace(const QString &path)
+{
+    QFile file(path);
+    int lineno = 0;
+    if(!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Cannot open trace " << path << ": " << file.errorString();
+        return false;
+    }
+    while(!file.atEnd()) {
+        QByteArray line = file.readLine().trimmed();
+        QJsonParseError err;
+        lineno++;
+        if(line.isEmpty() || line.startsWith('#'))
+            continue;
+        QJsonObject obj = QJsonDocument::fromJson(line, &err).object();
+        if(err.error != QJsonParseError::NoError || !signature(obj.value("method").toString())) {
+            qDebug() << "Skipping bad trace line " << lineno << ": " << line;
+            continue;
+        }
+        Call call;
+        call.at = (qint64)obj.value("at").toDouble();
+        call.method = obj.value("method").toString();
+        call.args = obj.value("args").toArray().toVariantList();
+        if(call.method == "updateFolder" || (call.method == "getMessage" && call.args.value(1).toUInt()) || call.method == "getMessageRange")
+            qDebug() << "Trace line " << lineno << ": " << call.method << " may wait for retrieval which never completes without messageserver";
+        _trace.append(call);
+    }
+    qDebug() << "Loaded " << _trace.size() << " calls from " << path;
+    return !_trace.isEmpty();
+}
+
+// Head unit like traffic: listing followed by burst of metadata and message fetches,
+// read toggles and an occasional push to keep store notifications flowing.
+void LoadGenerator::generateTrace(int count, int burst)
+{
+    qint64 at = 0;
+    for(int n = 0; n < count; n++) {
+        Call call;
+        int pick = n % burst;
+        call.at = at;
+        if(pick == 0) {
+            call.method = "listMessages";
+            call.args << "" << "INBOX" << 100 << 0 << QVariantMap();
+        } else if(pick % 10 == 0) {
+            call.method = "getMessage";
+            call.args << "@msg" << 0;
+        } else if(pick % 49 == 0) {
+            QVariantMap msg;
+            msg.insert("subject", QString("Load %1").arg(n));
+            msg.insert("body", QString("Generated by obexload"));
+            call.method = "putMessage";
+            call.args << msg << 0;
+        } else if(pick % 7 == 0) {
+            call.method = "setMessage";
+            call.args << "@msg" << 0 << (bool)(n % 2);
+        } else if(pick % 25 == 0) {
+            call.method = "listFolders";
+            call.args << "" << "" << 100 << 0;
+        } else {
+            call.method = "getMetadata";
+            call.args << "@msg" << 0;
+        }
+        _trace.append(call);
+        if(pick == burst - 1)
+            at += 100;
+    }
+}
+
+void LoadGenerator::fetchIds()
+{
+    QDBusMessage req = QDBusMessage::createMethodCall(ObexDBusInterface::dbusService, ObexDBusInterface::dbusPath,
+                                                      ObexDBusInterface::dbusService, "listMessages");
+    req << QString() << QString("INBOX") << QVariant::fromValue((quint16)1000) << QVariant::fromValue((quint16)0) << QVariantMap();
+    QDBusMessage rep = _conn.call(req);
+    if(rep.type() != QDBusMessage::ReplyMessage || rep.arguments().isEmpty()) {
+        qDebug() << "Cannot list messages: " << rep.errorMessage();
+        return;
+    }
+    const QDBusArgument arg = rep.arguments().first().value<QDBusArgument>();
+    arg.beginArray();
+    while(!arg.atEnd()) {
+        qint64 id;
+        arg >> id;
+        _ids.append(id);
+    }
+    arg.endArray();
+    qDebug() << "Using " << _ids.size() << " message ids";
+}
+
+bool LoadGenerator::marshal(const Call &call, QVariantList &args)
+{
+    const char *sig = signature(call.method);
+    if(!sig || (int)qstrlen(sig) != call.args.size()) {
+        qDebug() << "Wrong arguments for " << call.method << ": " << call.args;
+        return false;
+    }
+    for(int i = 0; sig[i]; i++) {
+        const QVariant &v = call.args.at(i);
+        switch(sig[i]) {
+        case 's':
+            args << v.toString();
+            break;
+        case 'q':
+            args << QVariant::fromValue((quint16)v.toUInt());
+            break;
+        case 'u':
+            args << QVariant::fromValue((quint32)v.toUInt());
+            break;
+        case 'y':
+            args << QVariant::fromValue((quint8)v.toUInt());
+            break;
+        case 'b':
+            args << v.toBool();
+            break;
+        case 'i':
+            args << v.toInt();
+            break;
+        case 'x':
+            if(v.toString() == "@msg")
+                args << QVariant::fromValue(_ids.isEmpty() ? (qint64)0 : _ids.at(qrand() % _ids.size()));
+            else
+                args << QVariant::fromValue(v.toLongLong());
+            break;
+        case 'm':
+            args << v.toMap();
+            break;
+        case 'l':
+            args << v.toStringList();
+            break;
+        }
+    }
+    return true;
+}
+
+void LoadGenerator::start()
+{
+    fetchIds();
+    _clock.start();
+    dispatch();
+}
+
+void LoadGenerator::dispatch()
+{
+    while(_next < _trace.size() && _inflight < _concurrency) {
+        const Call &call = _trace.at(_next);
+        qint64 due = _speed > 0 ? (qint64)(call.at / _speed) : 0;
+        QVariantList args;
+        if(due > _clock.elapsed()) {
+            _timer.start(due - _clock.elapsed());
+            return;
+        }
+        _next++;
+        if(!marshal(call, args)) {
+            _errors++;
+            continue;
+        }
+        QDBusMessage req = QDBusMessage::createMethodCall(ObexDBusInterface::dbusService, ObexDBusInterface::dbusPath,
+                                                          ObexDBusInterface::dbusService, call.method);
+        req.setArguments(args);
+        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(_conn.asyncCall(req), this);
+        connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), SLOT(callFinished(QDBusPendingCallWatcher*)));
+        _pending.insert(watcher, qMakePair(call.method, _clock.nsecsElapsed()));
+        _inflight++;
+    }
+    if(_next >= _trace.size() && _inflight == 0) {
+        _elapsed = _clock.nsecsElapsed();
+        emit finished();
+    }
+}
+
+void LoadGenerator::callFinished(QDBusPendingCallWatcher *call)
+{
+    QPair<QString, qint64> req = _pending.take(call);
+    _latency[req.first].append(_clock.nsecsElapsed() - req.second);
+    if(call->isError()) {
+        _errors++;
+        qDebug() << "Call " << req.first << " failed: " << call->error().message();
+    }
+    call->deleteLater();
+    _inflight--;
+    dispatch();
+}
+
+void LoadGenerator::mapEvent(const QDBusMessage &msg)
+{
+    Q_UNUSED(msg);
+    _events++;
+}
+
+void LoadGenerator::report(qint64 serverPid) const
+{
+    QVector<qint64> all;
+    QTextStream out(stdout);
+    out << QString("%1 %2 %3 %4 %5\n").arg("method", -16).arg("calls", 8).arg("p50 ms", 10).arg("p99 ms", 10).arg("max ms", 10);
+    foreach (const QString &method, _latency.keys()) {
+        QVector<qint64> lat = _latency.value(method);
+        std::sort(lat.begin(), lat.end());
+        all += lat;
+        out << QString("%1 %2 %3 %4 %5\n").arg(method, -16).arg(lat.size(), 8)
+               .arg(percentile(lat, 0.5) / 1e6, 10, 'f', 3).arg(percentile(lat, 0.99) / 1e6, 10, 'f', 3)
+               .arg(lat.last() / 1e6, 10, 'f', 3);
+    }
+    std::sort(all.begin(), all.end());
+    out << QString("%1 %2 %3 %4 %5\n").arg("total", -16).arg(all.size(), 8)
+           .arg(percentile(all, 0.5) / 1e6, 10, 'f', 3).arg(percentile(all, 0.99) / 1e6, 10, 'f', 3)
+           .arg(all.isEmpty() ? 0 : all.last() / 1e6, 10, 'f', 3);
+    out << "elapsed:    " << _elapsed / 1e9 << " s\n";
+    out << "throughput: " << (_elapsed ? all.size() * 1e9 / _elapsed : 0) << " calls/s\n";
+    out << "errors:     " << _errors << "\n";
+    out << "events:     " << _events << "\n";
+    out << "server rss: " << procStatus(serverPid, "VmRSS") << " (peak " << procStatus(serverPid, "VmHWM") << ")\n";
+}
@@ -0,0 +1,75 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QObject>
+#include <QVariantList>
+#include <QVector>
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QtDBus/QDBusConnection>
+
+class QDBusMessage;
+class QDBusPendingCallWatcher;
+
+/*
+ * Replays trace of org.sailfish.qmf.obex calls with bounded concurrency
+ * and collects end-to-end latency of every call.
+ *
+ * Trace is JSON per line: {"at": <ms>, "method": "<name>", "args": [...]}
+ * where "@msg" argument is substituted with random existing message id.
+ *
+ * No messageserver runs behind the synthetic store, so service actions
+ * never finish. putMessage and setMessage reply after their store write,
+ * their latency is real but each call leaves one idle action object in
+ * the server. updateFolder and getMessage/getMessageRange needing
+ * retrieval wait for the D-Bus timeout, keep them out of traces.
+ */
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+public:
+    struct Call {
+        qint64 at;
+        QString method;
+        QVariantList args;
+    };
+
+    LoadGenerator(const QDBusConnection &conn, int concurrency, double speed, QObject *parent = 0);
+
+    bool loadTrace(const QString &path);
+    void generateTrace(int count, int burst);
+    void report(qint64 serverPid) const;
+
+public slots:
+    void start();
+
+signals:
+    void finished();
+
+private slots:
+    void dispatch();
+    void callFinished(QDBusPendingCallWatcher *call);
+    void mapEvent(const QDBusMessage &msg);
+
+private:
+    bool marshal(const Call &call, QVariantList &args);
+    void fetchIds();
+
+    QDBusConnection _conn;
+    int _concurrency;
+    double _speed;
+    QList<Call> _trace;
+    QList<qint64> _ids;
+    int _next;
+    int _inflight;
+    int _errors;
+    int _events;
+    qint64 _elapsed;
+    QTimer _timer;
+    QElapsedTimer _clock;
+    QHash<QDBusPendingCallWatcher*, QPair<QString, qint64> > _pending;
+    QHash<QString, QVector<qint64> > _latency;
+};
+
+#endif // LOADGENERATOR_H
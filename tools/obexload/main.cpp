@@ -0,0 +1,114 @@
+#include "obexdbusinterface.h"
+#include "synthstore.h"
+#include "loadgenerator.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QtDBus/QDBusConnectionInterface>
+
+#include <QDebug>
+
+/*
+ * End-to-end load generator. Starts private dbus-daemon, spawns itself in
+ * --serve mode hosting the OBEX interface over synthetic QMF store and
+ * replays call trace against it through the bus.
+ */
+
+static int serve(int accounts, int messages)
+{
+    if(!populateStore(accounts, messages))
+        return 1;
+    new ObexDBusInterface(QCoreApplication::instance());
+    return QCoreApplication::exec();
+}
+
+static bool waitForService(const QDBusConnection &conn, QProcess &server, int timeout)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while(timer.elapsed() < timeout) {
+        if(conn.interface()->isServiceRegistered(ObexDBusInterface::dbusService))
+            return true;
+        // waitForFinished also lets QProcess notice the child exit
+        if(server.state() == QProcess::NotRunning || server.waitForFinished(100)) {
+            qDebug() << "Server exited with " << server.exitCode() << " before registering";
+            return false;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    QCommandLineOption serveOpt("serve", "Host OBEX interface (internal).");
+    QCommandLineOption traceOpt("trace", "Replay calls from JSON-per-line trace <file>.", "file");
+    QCommandLineOption requestsOpt("requests", "Number of generated calls without trace.", "n", "1000");
+    QCommandLineOption burstOpt("burst", "Calls per generated burst.", "n", "50");
+    QCommandLineOption concurrencyOpt("concurrency", "Calls in flight.", "n", "8");
+    QCommandLineOption speedOpt("speed", "Trace time scale, 0 replays as fast as possible.", "factor", "1");
+    QCommandLineOption accountsOpt("accounts", "Synthetic accounts.", "n", "1");
+    QCommandLineOption messagesOpt("messages", "Synthetic messages per account.", "n", "1000");
+
+    parser.setApplicationDescription("Trace replay load generator for org.sailfish.qmf.obex");
+    parser.addHelpOption();
+    parser.addOptions(QList<QCommandLineOption>() << serveOpt << traceOpt << requestsOpt << burstOpt
+                      << concurrencyOpt << speedOpt << accountsOpt << messagesOpt);
+    parser.process(app);
+
+    if(parser.isSet(serveOpt))
+        return serve(parser.value(accountsOpt).toInt(), parser.value(messagesOpt).toInt());
+
+    QTemporaryDir data;
+    QProcess daemon;
+    QProcess server;
+    QString address;
+    int ret = 0;
+
+    daemon.start("dbus-daemon", QStringList() << "--session" << "--nofork" << "--print-address=1");
+    if(!daemon.waitForStarted() || !daemon.waitForReadyRead()) {
+        qDebug() << "Cannot start private dbus-daemon";
+        return 1;
+    }
+    address = QString::fromUtf8(daemon.readLine()).trimmed();
+    qDebug() << "Private bus at " << address;
+
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    env.insert("DBUS_SESSION_BUS_ADDRESS", address);
+    env.insert("QMF_DATA", data.path());
+    server.setProcessEnvironment(env);
+    server.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    server.start(app.applicationFilePath(), QStringList() << "--serve"
+                 << "--accounts" << parser.value(accountsOpt) << "--messages" << parser.value(messagesOpt));
+
+    QDBusConnection conn = QDBusConnection::connectToBus(address, "obexload");
+    if(!conn.isConnected() || !waitForService(conn, server, 300000)) {
+        qDebug() << "OBEX interface did not show up on the bus";
+        ret = 1;
+    } else {
+        LoadGenerator gen(conn, parser.value(concurrencyOpt).toInt(), parser.value(speedOpt).toDouble());
+        if(parser.isSet(traceOpt)) {
+            if(!gen.loadTrace(parser.value(traceOpt)))
+                ret = 1;
+        } else {
+            gen.generateTrace(parser.value(requestsOpt).toInt(), qMax(1, parser.value(burstOpt).toInt()));
+        }
+        if(!ret) {
+            QObject::connect(&gen, SIGNAL(finished()), &app, SLOT(quit()));
+            QTimer::singleShot(0, &gen, SLOT(start()));
+            app.exec();
+            gen.report(server.processId());
+        }
+    }
+
+    server.terminate();
+    server.waitForFinished();
+    daemon.terminate();
+    daemon.waitForFinished();
+    return ret;
+}
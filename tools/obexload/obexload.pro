@@ -0,0 +1,33 @@
+TEMPLATE = app
+TARGET = obexload
+CONFIG += console
+CONFIG -= app_bundle
+
+QT += core dbus
+QT -= gui
+
+CONFIG += link_pkgconfig
+LIBS += -lqmfmessageserver5 -lqmfclient5
+PKGCONFIG += qmfclient5 qmfmessageserver5
+
+# Load generator is a development tool, it is built but not installed
+
+INCLUDEPATH += ../../src
+VPATH += ../../src
+
+HEADERS += \
+    obexdbusinterface.h \
+    obexchangejournal.h \
+    obextrace.h \
+    obexfoldercounts.h \
+    synthstore.h \
+    loadgenerator.h
+
+SOURCES += \
+    obexdbusinterface.cpp \
+    obexchangejournal.cpp \
+    obextrace.cpp \
+    obexfoldercounts.cpp \
+    synthstore.cpp \
+    loadgenerator.cpp \
+    main.cpp
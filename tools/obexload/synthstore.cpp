@@ -0,0 +1,92 @@
+#include "synthstore.h"
+
+#include <qmailstore.h>
+
+#include <QDebug>
+
+static const int batchSize = 500;
+
+static QMailFolderId addFolder(QMailAccount &acc, const QString &path, QMailFolder::StandardFolder type, quint64 status)
+{
+    QMailFolder qmf(path, QMailFolderId(), acc.id());
+    qmf.setDisplayName(path);
+    qmf.setStatus(status, true);
+    if(!QMailStore::instance()->addFolder(&qmf)) {
+        qDebug() << "Cannot add folder " << path;
+        return QMailFolderId();
+    }
+    acc.setStandardFolder(type, qmf.id());
+    return qmf.id();
+}
+
+static QMailMessage *synthMessage(const QMailAccount &acc, const QMailFolderId &fid, int n, bool outgoing)
+{
+    QMailMessage *qmm = new QMailMessage();
+    QMailMessageContentType type("text/plain; charset=UTF-8");
+    // Vary body length so listings see both short notes and long mails
+    QString text = QString("Synthetic message %1. ").arg(n).repeated(1 + (n * 7919) % 200);
+
+    qmm->setMessageType(acc.messageType());
+    qmm->setParentAccountId(acc.id());
+    qmm->setParentFolderId(fid);
+    qmm->setSubject(QString("Subject %1 thread %2").arg(n).arg(n % 97));
+    qmm->setDate(QMailTimeStamp(QDateTime::currentDateTimeUtc().addSecs(-60 * n)));
+    if(outgoing) {
+        qmm->setFrom(acc.fromAddress());
+        qmm->setTo(QMailAddress(QString("Peer %1 <peer%1@example.com>").arg(n % 53)));
+        qmm->setStatus(QMailMessage::Outgoing | QMailMessage::Sent, true);
+    } else {
+        qmm->setFrom(QMailAddress(QString("Peer %1 <peer%1@example.com>").arg(n % 53)));
+        qmm->setTo(acc.fromAddress());
+        qmm->setStatus(QMailMessage::Incoming, true);
+    }
+    qmm->setStatus(QMailMessage::Read, n % 3 == 0);
+    qmm->setStatus(QMailMessage::HighPriority, n % 17 == 0);
+    qmm->setBody(QMailMessageBody::fromData(text, type, QMailMessageBody::EightBit));
+    qmm->setStatus(QMailMessage::ContentAvailable, n % 5 != 0);
+    qmm->setStatus(QMailMessage::PartialContentAvailable, true);
+    return qmm;
+}
+
+bool populateStore(int accounts, int messages)
+{
+    QMailStore *store = QMailStore::instance();
+    for(int a = 0; a < accounts; a++) {
+        QMailAccount acc;
+        QList<QMailFolderId> folders;
+        QList<QMailMessage*> batch;
+
+        acc.setName(QString("synthetic%1").arg(a));
+        acc.setMessageType(QMailMessage::Email);
+        acc.setFromAddress(QMailAddress(QString("Synthetic %1 <synthetic%1@example.com>").arg(a)));
+        acc.setStatus(QMailAccount::Enabled | QMailAccount::CanTransmit, true);
+        acc.setStatus(QMailAccount::PreferredSender, a == 0);
+        if(!store->addAccount(&acc, 0)) {
+            qDebug() << "Cannot add account " << acc.name();
+            return false;
+        }
+        folders << addFolder(acc, "INBOX", QMailFolder::InboxFolder, 0)
+                << addFolder(acc, "Sent", QMailFolder::SentFolder, QMailFolder::Sent)
+                << addFolder(acc, "Drafts", QMailFolder::DraftsFolder, QMailFolder::Drafts)
+                << addFolder(acc, "Trash", QMailFolder::TrashFolder, QMailFolder::Trash)
+                << addFolder(acc, "Outbox", QMailFolder::OutboxFolder, 0);
+        store->updateAccount(&acc);
+
+        for(int n = 0; n < messages; n++) {
+            // Most traffic lands in INBOX, the rest in Sent
+            bool sent = n % 4 == 0;
+            batch.append(synthMessage(acc, folders.at(sent ? 1 : 0), n, sent));
+            if(batch.size() == batchSize || n == messages - 1) {
+                bool ok = store->addMessages(batch);
+                qDeleteAll(batch);
+                batch.clear();
+                if(!ok) {
+                    qDebug() << "Cannot add messages to " << acc.name();
+                    return false;
+                }
+            }
+        }
+        qDebug() << "Populated " << acc.name() << " with " << messages << " messages";
+    }
+    return true;
+}
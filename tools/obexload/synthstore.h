@@ -0,0 +1,10 @@
+#ifndef SYNTHSTORE_H
+#define SYNTHSTORE_H
+
+/*
+ * Fills empty QMF store (pointed to by QMF_DATA) with synthetic accounts,
+ * standard folders and messages for the load generator to play against.
+ */
+bool populateStore(int accounts, int messages);
+
+#endif // SYNTHSTORE_H